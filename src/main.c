@@ -3,7 +3,9 @@
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
 
+#define MEMTRACK_H_IMPLEMENTATION
 #define TENSOR_H_IMPLEMENTATION
 #include "tensor.h"
 
@@ -19,12 +21,80 @@ float sigmoidf_derivative(float x_sigmoid)
     return x_sigmoid * (1 - x_sigmoid); 
 }
 
+float identityf(float x)
+{
+    return x;
+}
+
+float identityf_derivative(float x)
+{
+    (void)x;
+    return 1.f;
+}
+
+#define NN_EXP_CHUNK 16
+
+// expf over one chunk with no libm call so it vectorizes, the Cephes
+// polynomial (~1 ulp). The selects get their own loops, gcc only if-converts
+// them at -O2 when they are alone in the body. The clamp is written so a
+// NaN compares false and passes through like it does in expf; the exponent
+// is taken from a NaN-free copy, the NaN reaches dst through r.
+static inline void nn_exp_chunk(float* restrict dst, const float* restrict src)
+{
+    float x[NN_EXP_CHUNK], xn[NN_EXP_CHUNK];
+    for (int m = 0; m < NN_EXP_CHUNK; ++m) {
+        float v = src[m];
+        v = v > 88.0f ? 88.0f : v;
+        x[m] = v < -87.0f ? -87.0f : v;
+    }
+
+    for (int m = 0; m < NN_EXP_CHUNK; ++m)
+        xn[m] = x[m] == x[m] ? x[m] : 0.0f;
+
+    for (int m = 0; m < NN_EXP_CHUNK; ++m) {
+        // round to nearest, fx + 128.5 is always positive so truncation floors
+        float fx = xn[m] * 1.44269504088896341f;
+        i32 n = (i32)(fx + 128.5f) - 128;
+        float r = x[m] - (float)n * 0.693359375f + (float)n * 2.12194440e-4f;
+
+        float p = 1.9875691500e-4f;
+        p = p * r + 1.3981999507e-3f;
+        p = p * r + 8.3334519073e-3f;
+        p = p * r + 4.1665795894e-2f;
+        p = p * r + 1.6666665459e-1f;
+        p = p * r + 5.0000001201e-1f;
+        p = p * r * r + r + 1.0f;
+
+        union { u32 u; float f; } scale = { .u = (u32)(n + 127) << 23 };
+        dst[m] = p * scale.f;
+    }
+}
+
+// MSE trains the sigmoid outputs as they are. The logit losses turn the
+// output layer into the identity, the output activations hold the logits
+// and the loss kernel applies sigmoid/softmax itself, which makes the
+// output gradient dC/dz = p - y with no dact term.
+typedef enum {
+    NN_LOSS_MSE,        // sigmoid outputs, squared error
+    NN_LOSS_BCE_LOGITS, // independent sigmoid outputs, binary cross-entropy
+    NN_LOSS_SOFTMAX_CE, // softmax over the outputs, cross-entropy
+} nn_loss_t;
+
+// per-layer ops with a choice of kernel, see nn_autotune
+typedef enum {
+    NN_OP_FORWARD,  // as = as_{l-1} . ws
+    NN_OP_BACKPROP, // weight and activation gradients of one layer
+    NN_OP_LEARN,    // elementwise updates of ws (bs stays on AUTO)
+    NN_OP_COUNT,
+} nn_op_t;
+
 typedef struct {
     tensor_t as;
     tensor_t ws;
     tensor_t bs;
     float (*act)(float z);
     float (*dact)(float z);
+    tensor_kernel_t kernels[NN_OP_COUNT];
 } layer_t;
 
 typedef struct {
@@ -37,6 +107,7 @@ typedef struct {
 #else
     layer_t* layers; // arch_count
 #endif
+    nn_loss_t loss;
 } nn_t;
 
 #define NN_INPUT(nn) ((nn)->layers[0].as)
@@ -63,12 +134,31 @@ float xor_train[] = {
     1, 1, 0,
 };
 
+// xor as two classes, one-hot labels
+float xor_onehot_train[] = {
+    0, 0, 1, 0,
+    0, 1, 0, 1,
+    1, 0, 0, 1,
+    1, 1, 1, 0,
+};
+
 #define TRAIN_COUNT 4
 #define TRAIN_FEATURES 2
 #define TRAIN_LABEL 1
 
 float* train = xor_train;
 
+// layout of the weight matrices, column-major makes the k loops over
+// MAT_AT(ws, k, j) in nn_forward and nn_backprop unit-stride
+#ifndef NN_WS_LAYOUT
+#define NN_WS_LAYOUT TENSOR_COL_MAJOR
+#endif
+
+static inline void nn_memtag(mem_tag_t owner, mem_tag_t tag)
+{
+    memtrack_set_tag(owner != MEM_UNTAGGED ? owner : tag);
+}
+
 void nn_alloc(nn_t* nn, size_t arch[], size_t arch_count)
 {
     nn->arch = arch;
@@ -86,18 +176,49 @@ void nn_alloc(nn_t* nn, size_t arch[], size_t arch_count)
         MAT_ALLOC(&nn->as[i], arch[i], 1);
     }
 #else
+    // an owner set by the caller (e.g. MEM_GRADIENTS) wins over the
+    // per-tensor tags
+    mem_tag_t owner = memtrack_set_tag(MEM_UNTAGGED);
+    nn_memtag(owner, MEM_UNTAGGED);
     nn->layers = NNC_MALLOC(sizeof(*nn->layers) * (nn->arch_count));
+    nn_memtag(owner, MEM_ACTIVATIONS);
     MAT_ALLOC(&nn->layers[0].as, 1, arch[0]);
     for (size_t i = 1; i < nn->arch_count; ++i) {
-        MAT_ALLOC(&nn->layers[i].ws, MAT_COLS(&nn->layers[i-1].as), arch[i]);
+        nn_memtag(owner, MEM_WEIGHTS);
+        MAT_ALLOC_LAYOUT(&nn->layers[i].ws, MAT_COLS(&nn->layers[i-1].as), arch[i], NN_WS_LAYOUT);
+        nn_memtag(owner, MEM_BIASES);
         MAT_ALLOC(&nn->layers[i].bs, 1, arch[i]);
+        nn_memtag(owner, MEM_ACTIVATIONS);
         MAT_ALLOC(&nn->layers[i].as, 1, arch[i]);
         nn->layers[i].act  = &sigmoidf;
         nn->layers[i].dact = &sigmoidf_derivative;
+        for (int op = 0; op < NN_OP_COUNT; ++op)
+            nn->layers[i].kernels[op] = TENSOR_KERNEL_AUTO;
     };
+    memtrack_set_tag(owner);
+    nn->loss = NN_LOSS_MSE;
 #endif
 }
 
+// footprint of this model alone, in bytes actually allocated for it: padded
+// capacity and alignment overhead included. Matches what memtrack accounts
+// to the model, memtrack_report() prints the process-wide totals.
+void nn_mem_report(nn_t* nn, const char* name)
+{
+    size_t params = 0;
+    size_t ws = 0, bs = 0, as = tensor_footprint(&nn->layers[0].as);
+    for (size_t i = 1; i < nn->arch_count; ++i) {
+        params += nn->layers[i].ws.size + nn->layers[i].bs.size;
+        ws += tensor_footprint(&nn->layers[i].ws);
+        bs += tensor_footprint(&nn->layers[i].bs);
+        as += tensor_footprint(&nn->layers[i].as);
+    }
+    size_t layers = sizeof(*nn->layers) * nn->arch_count;
+
+    printf("%s: params(%ld) weights(%ld B) biases(%ld B) activations(%ld B) layers(%ld B) total(%ld B)\n",
+           name, params, ws, bs, as, layers, ws + bs + as + layers);
+}
+
 void nn_free(nn_t* nn)
 {
     MAT_FREE(&nn->layers[0].as);
@@ -125,14 +246,50 @@ void nn_print(nn_t* nn)
     // tensor_print(&nn->layers[nn->arch_count - 1].as, buf, false);
 }
 
-void nn_rand(nn_t* nn, float low, float high)
+typedef enum {
+    NN_INIT_UNIFORM,
+    NN_INIT_XAVIER, // U(-sqrt(6/(fan_in+fan_out)), +sqrt(6/(fan_in+fan_out)))
+    NN_INIT_HE,     // U(-sqrt(6/fan_in), +sqrt(6/fan_in))
+} nn_init_t;
+
+// Each layer draws from its own stream split off a single base seed, so the
+// parameters of layer i do not depend on the size of the other layers nor on
+// the order (or thread) in which layers get initialized.
+void nn_init(nn_t* nn, nn_init_t init, float low, float high)
 {
+    rng_t base, layer;
+    rng_seed(&base, rng_next_u64(&tensor_rng), 0);
+
     for (size_t i = 1; i < nn->arch_count; ++i) {
-        MAT_RAND(&nn->layers[i].bs, low, high);
-        MAT_RAND(&nn->layers[i].ws, low, high);
+        float fan_in  = MAT_ROWS(&nn->layers[i].ws);
+        float fan_out = MAT_COLS(&nn->layers[i].ws);
+        float limit;
+
+        switch (init) {
+        case NN_INIT_XAVIER: limit = sqrtf(6.0f / (fan_in + fan_out)); break;
+        case NN_INIT_HE:     limit = sqrtf(6.0f / fan_in); break;
+        default:             limit = 0.0f; break;
+        }
+
+        rng_split(&layer, &base, 2 * i);
+        if (init == NN_INIT_UNIFORM)
+            tensor_rand_rng(&nn->layers[i].ws, &layer, low, high);
+        else
+            tensor_rand_rng(&nn->layers[i].ws, &layer, -limit, limit);
+
+        rng_split(&layer, &base, 2 * i + 1);
+        if (init == NN_INIT_UNIFORM)
+            tensor_rand_rng(&nn->layers[i].bs, &layer, low, high);
+        else
+            MAT_FILL(&nn->layers[i].bs, 0.0f);
     }
 }
 
+void nn_rand(nn_t* nn, float low, float high)
+{
+    nn_init(nn, NN_INIT_UNIFORM, low, high);
+}
+
 void nn_fill(nn_t* nn, float value)
 {
     for (size_t i = 1; i < nn->arch_count; ++i) {
@@ -145,12 +302,224 @@ void nn_fill(nn_t* nn, float value)
 void nn_forward(nn_t* nn)
 {
     for (size_t i = 1; i < nn->arch_count; ++i) {
-        MAT_DOT(&nn->layers[i].as, &nn->layers[i-1].as, &nn->layers[i].ws);
+        tensor_2d_dot_product_kernel(&nn->layers[i].as, &nn->layers[i-1].as, &nn->layers[i].ws,
+                                     nn->layers[i].kernels[NN_OP_FORWARD]);
         MAT_SUM(&nn->layers[i].as, &nn->layers[i].bs);
         MAT_ACT(&nn->layers[i].as, nn->layers[i].act);
     }
 }
 
+void nn_set_loss(nn_t* nn, nn_loss_t loss)
+{
+    layer_t* out = &nn->layers[nn->arch_count - 1];
+    nn->loss = loss;
+    out->act  = loss == NN_LOSS_MSE ? &sigmoidf : &identityf;
+    out->dact = loss == NN_LOSS_MSE ? &sigmoidf_derivative : &identityf_derivative;
+}
+
+// Loss of one sample, given the output row (activations for MSE, logits
+// otherwise). When grad is not NULL the gradient wrt that row is written in
+// the same pass, it is what nn_backprop seeds the output layer with.
+
+static float nn_loss_mse(const tensor_t* a, const row_t* y, tensor_t* grad)
+{
+    float loss = 0.0f;
+    for (u32 j = 0; j < MAT_COLS(a); ++j) {
+        float d = MAT_AT(a, 0, j) - ROW_AT(y, j);
+        loss += d * d;
+        if (grad != NULL)
+            MAT_AT(grad, 0, j) = 2.0f * d;
+    }
+    return loss;
+}
+
+// max(z, 0) - z*y + log(1 + exp(-|z|)) never overflows, p - y needs only sigmoid
+static float nn_loss_bce_logits(const tensor_t* z, const row_t* y, tensor_t* grad)
+{
+    float loss = 0.0f;
+    for (u32 j = 0; j < MAT_COLS(z); ++j) {
+        float zj = MAT_AT(z, 0, j);
+        float yj = ROW_AT(y, j);
+        float e = expf(-fabsf(zj));
+        loss += fmaxf(zj, 0.0f) - zj * yj + log1pf(e);
+        if (grad != NULL) {
+            // sigmoid(z) from the same exp(-|z|)
+            float p = zj >= 0.0f ? 1.0f / (1.0f + e) : e / (1.0f + e);
+            MAT_AT(grad, 0, j) = p - yj;
+        }
+    }
+    return loss;
+}
+
+static inline void nn_softmax_store_chunk(float* restrict e, float* restrict sum, const float* restrict t)
+{
+    for (int m = 0; m < NN_EXP_CHUNK; ++m) {
+        e[m] = t[m];
+        sum[m] += t[m];
+    }
+}
+
+// e[j] = exp(z[j] - max) over n unit-stride logits, returns the sum of e
+// and the max in *max. e may alias z. Rows of at least one chunk go
+// chunk-wise through lane arrays, the tail included; a shorter row costs
+// less with libm expf than with a whole chunk of the polynomial.
+static float nn_softmax_exp(float* e, const float* z, u32 n, float* max)
+{
+    if (n < NN_EXP_CHUNK) {
+        float zmax = z[0];
+        for (u32 j = 1; j < n; ++j)
+            zmax = z[j] > zmax ? z[j] : zmax;
+        *max = zmax;
+
+        float sum = 0.0f;
+        for (u32 j = 0; j < n; ++j) {
+            e[j] = expf(z[j] - zmax);
+            sum += e[j];
+        }
+        return sum;
+    }
+
+    u32 full = n / NN_EXP_CHUNK * NN_EXP_CHUNK;
+
+    float lane_max[NN_EXP_CHUNK];
+    for (int m = 0; m < NN_EXP_CHUNK; ++m)
+        lane_max[m] = -FLT_MAX;
+    for (u32 j = 0; j < full; j += NN_EXP_CHUNK) {
+        for (int m = 0; m < NN_EXP_CHUNK; ++m)
+            lane_max[m] = z[j + m] > lane_max[m] ? z[j + m] : lane_max[m];
+    }
+
+    float zmax = -FLT_MAX;
+    for (int m = 0; m < NN_EXP_CHUNK; ++m)
+        zmax = lane_max[m] > zmax ? lane_max[m] : zmax;
+    for (u32 j = full; j < n; ++j)
+        zmax = z[j] > zmax ? z[j] : zmax;
+    *max = zmax;
+
+    float x[NN_EXP_CHUNK], t[NN_EXP_CHUNK];
+    float lane_sum[NN_EXP_CHUNK] = {0};
+    for (u32 j = 0; j < n; j += NN_EXP_CHUNK) {
+        u32 len = n - j < NN_EXP_CHUNK ? n - j : NN_EXP_CHUNK;
+        if (len == NN_EXP_CHUNK) {
+            for (int m = 0; m < NN_EXP_CHUNK; ++m)
+                x[m] = z[j + m] - zmax;
+        } else {
+            // the lanes past the tail see exp(-87) and are never read
+            for (int m = 0; m < NN_EXP_CHUNK; ++m)
+                x[m] = -87.0f;
+            for (u32 m = 0; m < len; ++m)
+                x[m] = z[j + m] - zmax;
+        }
+
+        nn_exp_chunk(t, x);
+
+        if (len == NN_EXP_CHUNK) {
+            nn_softmax_store_chunk(&e[j], lane_sum, t);
+        } else {
+            for (u32 m = 0; m < len; ++m) {
+                e[j + m] = t[m];
+                lane_sum[m] += t[m];
+            }
+        }
+    }
+
+    float sum = 0.0f;
+    for (int m = 0; m < NN_EXP_CHUNK; ++m)
+        sum += lane_sum[m];
+    return sum;
+}
+
+// softmax of n unit-stride logits into p, p may alias z
+static void nn_softmax(float* p, const float* z, u32 n)
+{
+    float max;
+    float inv_sum = 1.0f / nn_softmax_exp(p, z, n, &max);
+    for (size_t j = 0; j < n; ++j)
+        p[j] *= inv_sum;
+}
+
+// g = e * inv_sum - y over one chunk, e is read from and replaced in g
+static inline void nn_softmax_ce_grad_chunk(float* restrict g, const float* restrict y, float inv_sum)
+{
+    for (int m = 0; m < NN_EXP_CHUNK; ++m)
+        g[m] = g[m] * inv_sum - y[m];
+}
+
+// acc -= y * (z - log_sum_exp) over one chunk, lane-wise
+static inline void nn_softmax_ce_loss_chunk(float* restrict acc, const float* restrict z, const float* restrict y, float shift)
+{
+    for (int m = 0; m < NN_EXP_CHUNK; ++m)
+        acc[m] -= y[m] * (z[m] - shift);
+}
+
+// log-sum-exp shifted by the max logit: a max pass, one exp/sum pass whose
+// exp(z - max) is kept in grad, and one gradient/loss pass, chunk-wise over
+// lane arrays (see nn_softmax_exp for rows shorter than a chunk).
+static float nn_loss_softmax_ce(const tensor_t* z, const row_t* y, tensor_t* grad)
+{
+    u32 n = MAT_COLS(z);
+    NNC_ASSERT(z->stride[1] == 1 && (grad == NULL || grad->stride[1] == 1));
+
+    // widths are u8, a row always fits the scratch buffers
+    float scratch[256], y_unit[256];
+    const float* zp = &MAT_AT(z, 0, 0);
+    float* e = grad != NULL ? &MAT_AT(grad, 0, 0) : scratch;
+
+    const float* yp = &ROW_AT(y, 0);
+    if (y->stride[0] != 1) {
+        for (u32 j = 0; j < n; ++j)
+            y_unit[j] = ROW_AT(y, j);
+        yp = y_unit;
+    }
+
+    float max;
+    float sum = nn_softmax_exp(e, zp, n, &max);
+    float shift = max + logf(sum);
+    float inv_sum = 1.0f / sum;
+
+    float acc[NN_EXP_CHUNK] = {0};
+    u32 full = n / NN_EXP_CHUNK * NN_EXP_CHUNK;
+    for (u32 j = 0; j < full; j += NN_EXP_CHUNK) {
+        nn_softmax_ce_loss_chunk(acc, &zp[j], &yp[j], shift);
+        if (grad != NULL)
+            nn_softmax_ce_grad_chunk(&e[j], &yp[j], inv_sum);
+    }
+
+    float loss = 0.0f;
+    for (int m = 0; m < NN_EXP_CHUNK; ++m)
+        loss += acc[m];
+    for (u32 j = full; j < n; ++j) {
+        loss -= yp[j] * (zp[j] - shift);
+        if (grad != NULL)
+            e[j] = e[j] * inv_sum - yp[j];
+    }
+    return loss;
+}
+
+static float nn_loss(nn_t* nn, const row_t* y, tensor_t* grad)
+{
+    switch (nn->loss) {
+    case NN_LOSS_BCE_LOGITS: return nn_loss_bce_logits(&NN_OUTPUT(nn), y, grad);
+    case NN_LOSS_SOFTMAX_CE: return nn_loss_softmax_ce(&NN_OUTPUT(nn), y, grad);
+    default:                 return nn_loss_mse(&NN_OUTPUT(nn), y, grad);
+    }
+}
+
+// nn_forward plus the output transform of the loss, probabilities instead
+// of logits for the logit losses
+void nn_predict(nn_t* nn)
+{
+    nn_forward(nn);
+
+    tensor_t* out = &NN_OUTPUT(nn);
+    if (nn->loss == NN_LOSS_BCE_LOGITS) {
+        MAT_ACT(out, &sigmoidf);
+    } else if (nn->loss == NN_LOSS_SOFTMAX_CE) {
+        NNC_ASSERT(out->stride[1] == 1);
+        nn_softmax(&MAT_AT(out, 0, 0), &MAT_AT(out, 0, 0), MAT_COLS(out));
+    }
+}
+
 float nn_cost(nn_t* nn, tensor_t* target)
 {
     tensor_t* input_mat  = &NN_INPUT(nn);
@@ -170,10 +539,7 @@ float nn_cost(nn_t* nn, tensor_t* target)
         ROW_COPY(input_mat, &x);
         nn_forward(nn);
 
-        for (size_t j = 0; j < MAT_COLS(output_mat); ++j) {
-            float d =  MAT_AT(output_mat, 0, j) - ROW_AT(&y, j);
-            cost += d * d;
-        }
+        cost += nn_loss(nn, &y, NULL);
     }
     return cost /= samples;
 }
@@ -202,6 +568,50 @@ void nn_finite_diff(nn_t* nn, nn_t* grad, tensor_t* target, float eps)
     }
 }
 
+// dC/dw_kj += delta_j * a_k and dC/da_k += delta_j * w_kj over a padded run
+static inline void nn_backprop_accumulate(float* restrict gw, float* restrict ga, float delta,
+                                          const float* restrict a, const float* restrict w, u32 n)
+{
+    for (size_t k = 0; k < n; k += TENSOR_PAD) {
+        for (size_t m = 0; m < TENSOR_PAD; ++m) {
+            gw[k + m] += delta * a[k + m];
+            ga[k + m] += delta * w[k + m];
+        }
+    }
+}
+
+// weight and previous activation gradients for neuron j of layer l
+static void nn_backprop_neuron(nn_t* nn, nn_t* grad, size_t l, size_t j, float delta)
+{
+    tensor_kernel_t kernel = nn->layers[l].kernels[NN_OP_BACKPROP];
+    if (kernel == TENSOR_KERNEL_AUTO)
+        kernel = MAT_ROWS(&nn->layers[l].ws) >= TENSOR_PAD_MIN ? TENSOR_KERNEL_PADDED : TENSOR_KERNEL_STRIDED;
+
+    if (nn->layers[l].ws.stride[0] == 1 && kernel != TENSOR_KERNEL_STRIDED) {
+        // column-major: column j of ws and the a_{l-1} row are
+        // unit-stride runs with zero padding, same sums as below
+        nn_backprop_accumulate(&MAT_AT(&grad->layers[l].ws, 0, j),
+                               grad->layers[l-1].as.data, delta,
+                               nn->layers[l-1].as.data,
+                               &MAT_AT(&nn->layers[l].ws, 0, j),
+                               nn->layers[l].ws.stride[1]);
+        return;
+    }
+
+    // iterate over neurons in the previous layer 'l-1'
+    for (size_t k = 0; k < MAT_COLS(&nn->layers[l-1].as); ++k) {
+        float prev_a = MAT_AT(&nn->layers[l-1].as, 0, k); // a_{l-1}
+        float w = MAT_AT(&nn->layers[l].ws, k, j);        // w_kj
+
+        // accumulate gradient for the weight (dC/dw = dC/dz * a_{l-1})
+        MAT_AT(&grad->layers[l].ws, k, j) += delta * prev_a;
+
+        // propagate error to the previous layer's activation gradient
+        // (dC/da_{l-1} = SUM over j of dC/dz_l * w_kj)
+        MAT_AT(&grad->layers[l-1].as, 0, k) += delta * w;
+    }
+}
+
 void nn_backprop(nn_t* nn, nn_t* grad, tensor_t* target)
 {
     assert(MAT_COLS(&NN_INPUT(nn)) + MAT_COLS(&NN_OUTPUT(nn)) == MAT_COLS(target));
@@ -226,12 +636,7 @@ void nn_backprop(nn_t* nn, nn_t* grad, tensor_t* target)
         }
 
         // compute the last layer activation gradient
-        size_t last_layer = nn->arch_count - 1;
-        for (size_t j = 0; j < MAT_COLS(&NN_OUTPUT(nn)); ++j) {
-            float a = MAT_AT(&NN_OUTPUT(nn), 0, j);
-            float expected = ROW_AT(&y, j);
-            MAT_AT(&grad->layers[last_layer].as, 0, j) = 2.0f * (a - expected);
-        }
+        nn_loss(nn, &y, &NN_OUTPUT(grad));
 
         for (size_t l = nn->arch_count - 1; l > 0; --l) {
             for (size_t j = 0; j < MAT_COLS(&nn->layers[l].as); ++j) {
@@ -242,77 +647,749 @@ void nn_backprop(nn_t* nn, nn_t* grad, tensor_t* target)
                 float delta = dC_da * da_dz;
                 MAT_AT(&grad->layers[l].bs, 0, j) += delta;
 
-                // iterate over neurons in the previous layer 'l-1'
-                for (size_t k = 0; k < MAT_COLS(&nn->layers[l-1].as); ++k) {
-                    float prev_a = MAT_AT(&nn->layers[l-1].as, 0, k); // a_{l-1}
-                    float w = MAT_AT(&nn->layers[l].ws, k, j);        // w_kj
-
-                    // accumulate gradient for the weight (dC/dw = dC/dz * a_{l-1})
-                    MAT_AT(&grad->layers[l].ws, k, j) += delta * prev_a;
-
-                    // propagate error to the previous layer's activation gradient
-                    // (dC/da_{l-1} = SUM over j of dC/dz_l * w_kj)
-                    MAT_AT(&grad->layers[l-1].as, 0, k) += delta * w;
-                }
+                nn_backprop_neuron(nn, grad, l, j, delta);
             }
         }
     }
     for (size_t l = 1; l < nn->arch_count; ++l) {
-        for (size_t j = 0; j < MAT_ROWS(&grad->layers[l].ws); ++j) {
-            for (size_t k = 0; k < MAT_COLS(&grad->layers[l].ws); ++k) {
-                MAT_AT(&grad->layers[l].ws, j, k) /= samples;
-            }
-        }
-        for (size_t j = 0; j < MAT_COLS(&grad->layers[l].bs); ++j) {
-            MAT_AT(&grad->layers[l].bs, 0, j) /= samples;
-        }
+        tensor_kernel_t kernel = nn->layers[l].kernels[NN_OP_LEARN];
+        tensor_scale_kernel(&grad->layers[l].ws, 1.0f / samples, kernel);
+        tensor_scale(&grad->layers[l].bs, 1.0f / samples);
     }
 }
 
+// the padding of grad and nn is zero in both, so a flat pass over the
+// allocation only touches the logical elements. The tuned learn kernel is
+// keyed on the ws shape, bs keeps the AUTO choice of its own shape.
 void nn_learn(nn_t* nn, nn_t* grad, float rate)
 {
     for (size_t l = 1; l < nn->arch_count; ++l) {
-        for (size_t j = 0; j < MAT_ROWS(&nn->layers[l].ws); ++j) {
-            for (size_t k = 0; k < MAT_COLS(&nn->layers[l].ws); ++k) {
-                MAT_AT(&nn->layers[l].ws, j, k) -= rate * MAT_AT(&grad->layers[l].ws, j, k);
+        tensor_kernel_t kernel = nn->layers[l].kernels[NN_OP_LEARN];
+        tensor_axpy_kernel(&nn->layers[l].ws, &grad->layers[l].ws, -rate, kernel);
+        tensor_axpy(&nn->layers[l].bs, &grad->layers[l].bs, -rate);
+    }
+}
+
+// Kernel autotuning. Each (op, ws shape, layout) of the arch is timed with
+// every candidate kernel the first time it is seen on a host, the winner
+// goes into a cache file keyed by cpu model and shape. Later runs only read
+// the file, so startup stays cheap. One line per entry:
+//   <cpu model>\t<op>\t<rows>\t<cols>\t<layout>\t<kernel>
+
+#define NN_AUTOTUNE_CACHE "nnc_tune.cache"
+#define NN_AUTOTUNE_MIN_TIME 1e-3 // seconds, shortest timed sample
+#define NN_AUTOTUNE_SAMPLES 3
+
+typedef struct {
+    nn_op_t op;
+    u32 rows;
+    u32 cols;
+    bool col_major;
+    tensor_kernel_t kernel;
+} nn_tune_entry_t;
+
+static const char* nn_op_names[NN_OP_COUNT] = {
+    [NN_OP_FORWARD]  = "forward",
+    [NN_OP_BACKPROP] = "backprop",
+    [NN_OP_LEARN]    = "learn",
+};
+
+static const char* nn_kernel_names[TENSOR_KERNEL_COUNT] = {
+    [TENSOR_KERNEL_AUTO]      = "auto",
+    [TENSOR_KERNEL_STRIDED]   = "strided",
+    [TENSOR_KERNEL_PADDED]    = "padded",
+    [TENSOR_KERNEL_PADDED_X2] = "padded_x2",
+};
+
+// kernels each ws layout actually implements, indexed [col_major][op].
+// Row-major ws has no padded backprop and its padded forward does not
+// unroll, offering those would only time two copies of the same loop.
+static const tensor_kernel_t nn_tune_candidates[2][NN_OP_COUNT][TENSOR_KERNEL_COUNT] = {
+    [false] = {
+        [NN_OP_FORWARD]  = { TENSOR_KERNEL_STRIDED, TENSOR_KERNEL_PADDED },
+        [NN_OP_BACKPROP] = { TENSOR_KERNEL_STRIDED },
+        [NN_OP_LEARN]    = { TENSOR_KERNEL_STRIDED, TENSOR_KERNEL_PADDED },
+    },
+    [true] = {
+        [NN_OP_FORWARD]  = { TENSOR_KERNEL_STRIDED, TENSOR_KERNEL_PADDED, TENSOR_KERNEL_PADDED_X2 },
+        [NN_OP_BACKPROP] = { TENSOR_KERNEL_STRIDED, TENSOR_KERNEL_PADDED },
+        [NN_OP_LEARN]    = { TENSOR_KERNEL_STRIDED, TENSOR_KERNEL_PADDED },
+    },
+};
+
+static int nn_name_lookup(const char** names, int count, const char* name)
+{
+    for (int i = 0; i < count; ++i) {
+        if (names[i] != NULL && strcmp(names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// "model name" of /proc/cpuinfo, the cache key of the host
+static void nn_cpu_model(char* buf, size_t size)
+{
+    snprintf(buf, size, "unknown");
+
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL)
+        return;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char* colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) != 0 || colon == NULL)
+            continue;
+        colon += strspn(colon + 1, " ") + 1;
+        colon[strcspn(colon, "\t\n")] = '\0';
+        snprintf(buf, size, "%s", colon);
+        break;
+    }
+    fclose(f);
+}
+
+static nn_tune_entry_t* nn_tune_find(nn_tune_entry_t* entries, size_t count,
+                                     nn_op_t op, u32 rows, u32 cols, bool col_major)
+{
+    for (size_t e = 0; e < count; ++e) {
+        if (entries[e].op == op && entries[e].rows == rows &&
+            entries[e].cols == cols && entries[e].col_major == col_major)
+            return &entries[e];
+    }
+    return NULL;
+}
+
+static bool nn_tune_wanted(const nn_t* nn, u32 rows, u32 cols, bool col_major)
+{
+    for (size_t l = 1; l < nn->arch_count; ++l) {
+        const tensor_t* ws = &nn->layers[l].ws;
+        if (MAT_ROWS(ws) == rows && MAT_COLS(ws) == cols && (ws->stride[0] == 1) == col_major)
+            return true;
+    }
+    return false;
+}
+
+// reads the entries of this host for the ws shapes of nn, at most one per
+// (op, shape, layout) with the first line winning. A cache shared between
+// many arches stays usable however long it gets, entries is sized for the
+// keys of a single arch.
+static size_t nn_tune_load(const char* path, const char* cpu, const nn_t* nn, nn_tune_entry_t* entries)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+
+    size_t count = 0;
+    char line[512], key[256], op[32], layout[8], kernel[32];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        nn_tune_entry_t* e = &entries[count];
+        if (sscanf(line, "%255[^\t]\t%31s\t%u\t%u\t%7s\t%31s",
+                   key, op, &e->rows, &e->cols, layout, kernel) != 6)
+            continue;
+        if (strcmp(key, cpu) != 0)
+            continue;
+
+        int o = nn_name_lookup(nn_op_names, NN_OP_COUNT, op);
+        int k = nn_name_lookup(nn_kernel_names, TENSOR_KERNEL_COUNT, kernel);
+        if (o < 0 || k < 0)
+            continue;
+
+        e->op = o;
+        e->kernel = k;
+        e->col_major = strcmp(layout, "col") == 0;
+        if (!nn_tune_wanted(nn, e->rows, e->cols, e->col_major) ||
+            nn_tune_find(entries, count, e->op, e->rows, e->cols, e->col_major) != NULL)
+            continue;
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static void nn_tune_run(nn_t* nn, nn_t* grad, size_t l, nn_op_t op)
+{
+    tensor_kernel_t kernel = nn->layers[l].kernels[op];
+    switch (op) {
+    case NN_OP_FORWARD:
+        tensor_2d_dot_product_kernel(&nn->layers[l].as, &nn->layers[l-1].as, &nn->layers[l].ws, kernel);
+        break;
+    case NN_OP_BACKPROP:
+        for (size_t j = 0; j < MAT_COLS(&nn->layers[l].as); ++j)
+            nn_backprop_neuron(nn, grad, l, j, 1e-3f);
+        break;
+    case NN_OP_LEARN:
+        // the grad copy is the one written, nn stays untouched
+        tensor_scale_kernel(&grad->layers[l].ws, 1.0f, kernel);
+        tensor_axpy_kernel(&grad->layers[l].ws, &nn->layers[l].ws, 0.0f, kernel);
+        break;
+    default:
+        break;
+    }
+}
+
+// best of NN_AUTOTUNE_SAMPLES, seconds per call
+static double nn_tune_time(nn_t* nn, nn_t* grad, size_t l, nn_op_t op)
+{
+    stopwatch_t sw;
+    double elapsed;
+    size_t reps = 1;
+
+    for (;;) {
+        stopwatch_start(&sw);
+        for (size_t r = 0; r < reps; ++r)
+            nn_tune_run(nn, grad, l, op);
+        stopwatch_stop(&sw);
+        elapsed = stopwatch_get_elapsed_seconds(&sw, get_timer_frequency());
+        if (elapsed >= NN_AUTOTUNE_MIN_TIME)
+            break;
+        reps *= 2;
+    }
+
+    double best = elapsed / reps;
+    for (int s = 1; s < NN_AUTOTUNE_SAMPLES; ++s) {
+        stopwatch_start(&sw);
+        for (size_t r = 0; r < reps; ++r)
+            nn_tune_run(nn, grad, l, op);
+        stopwatch_stop(&sw);
+        elapsed = stopwatch_get_elapsed_seconds(&sw, get_timer_frequency()) / reps;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+// picks the kernels of every layer of nn, from the cache at path when it has
+// them and by timing the candidates otherwise. Returns how many entries had
+// to be tuned (and were appended to the cache).
+size_t nn_autotune(nn_t* nn, const char* path)
+{
+    char cpu[128];
+    nn_cpu_model(cpu, sizeof(cpu));
+
+    // every key of this arch fits, loaded or tuned, so nothing is appended
+    // to the file twice
+    nn_tune_entry_t* entries = NNC_MALLOC(sizeof(*entries) * (nn->arch_count - 1) * NN_OP_COUNT);
+    NNC_ASSERT(entries != NULL);
+    size_t count = nn_tune_load(path, cpu, nn, entries);
+
+    nn_t grad = {0};
+    FILE* out = NULL;
+    size_t tuned = 0;
+
+    for (size_t l = 1; l < nn->arch_count; ++l) {
+        tensor_t* ws = &nn->layers[l].ws;
+        bool col_major = ws->stride[0] == 1;
+
+        for (int op = 0; op < NN_OP_COUNT; ++op) {
+            nn_tune_entry_t* hit = nn_tune_find(entries, count, op, MAT_ROWS(ws), MAT_COLS(ws), col_major);
+            if (hit != NULL) {
+                nn->layers[l].kernels[op] = hit->kernel;
+                continue;
             }
-        }
-        for (size_t j = 0; j < MAT_COLS(&nn->layers[l].bs); ++j) {
-            MAT_AT(&nn->layers[l].bs, 0, j) -= rate * MAT_AT(&grad->layers[l].bs, 0, j);
+
+            // nothing to choose between, no timing and no cache entry
+            const tensor_kernel_t* candidates = nn_tune_candidates[col_major][op];
+            if (candidates[1] == TENSOR_KERNEL_AUTO) {
+                nn->layers[l].kernels[op] = candidates[0];
+                continue;
+            }
+
+            if (grad.layers == NULL) {
+                mem_tag_t tag = memtrack_set_tag(MEM_GRADIENTS);
+                nn_alloc(&grad, nn->arch, nn->arch_count);
+                memtrack_set_tag(tag);
+            }
+
+            tensor_kernel_t best = TENSOR_KERNEL_AUTO;
+            double best_time = 0.0;
+            for (int c = 0; c < TENSOR_KERNEL_COUNT; ++c) {
+                tensor_kernel_t kernel = candidates[c];
+                if (kernel == TENSOR_KERNEL_AUTO)
+                    continue;
+                nn->layers[l].kernels[op] = kernel;
+                double t = nn_tune_time(nn, &grad, l, op);
+                if (best == TENSOR_KERNEL_AUTO || t < best_time) {
+                    best = kernel;
+                    best_time = t;
+                }
+            }
+            nn->layers[l].kernels[op] = best;
+            tuned++;
+
+            if (out == NULL)
+                out = fopen(path, "a");
+            if (out != NULL)
+                fprintf(out, "%s\t%s\t%u\t%u\t%s\t%s\n", cpu, nn_op_names[op], MAT_ROWS(ws),
+                        MAT_COLS(ws), col_major ? "col" : "row", nn_kernel_names[best]);
+
+            entries[count++] = (nn_tune_entry_t) {
+                .op = op, .rows = MAT_ROWS(ws), .cols = MAT_COLS(ws),
+                .col_major = col_major, .kernel = best,
+            };
         }
     }
+
+    if (out != NULL)
+        fclose(out);
+    NNC_FREE(entries);
+    if (grad.layers != NULL)
+        nn_free(&grad);
+
+    return tuned;
+}
+
+void nn_print_kernels(nn_t* nn)
+{
+    for (size_t l = 1; l < nn->arch_count; ++l) {
+        printf("layer %ld:", l);
+        for (int op = 0; op < NN_OP_COUNT; ++op)
+            printf(" %s(%s)", nn_op_names[op], nn_kernel_names[nn->layers[l].kernels[op]]);
+        printf("\n");
+    }
 }
 
 void nn_train_finite_diff(nn_t* nn, tensor_t* target, size_t epochs, float rate, float eps, size_t batch_size)
 {
     nn_t grad;
+    mem_tag_t tag = memtrack_set_tag(MEM_GRADIENTS);
     nn_alloc(&grad, nn->arch, nn->arch_count);
+    memtrack_set_tag(tag);
     nn_fill(&grad, 0);
+    u64 allocs = memtrack_alloc_count();
     for (size_t epoch = 0; epoch < epochs; ++epoch) {
         nn_finite_diff(nn, &grad, target, eps);
         nn_learn(nn, &grad, rate);
     }
+    if (memtrack_alloc_count() != allocs)
+        fprintf(stderr, "nn_train_finite_diff: %lu allocations in the training loop\n",
+                memtrack_alloc_count() - allocs);
     nn_free(&grad);
 }
 
 void nn_train(nn_t* nn, tensor_t* target, size_t epochs, float rate, size_t batch_size)
 {
     nn_t grad;
+    mem_tag_t tag = memtrack_set_tag(MEM_GRADIENTS);
     nn_alloc(&grad, nn->arch, nn->arch_count);
+    memtrack_set_tag(tag);
     nn_fill(&grad, 0);
+    u64 allocs = memtrack_alloc_count();
     for (size_t epoch = 0; epoch < epochs; ++epoch) {
         nn_backprop(nn, &grad, target);
         nn_learn(nn, &grad, rate);
     }
+    if (memtrack_alloc_count() != allocs)
+        fprintf(stderr, "nn_train: %lu allocations in the training loop\n",
+                memtrack_alloc_count() - allocs);
     nn_free(&grad);
 }
 
+// Model batch: `count` networks of the same arch trained in lockstep.
+//
+// Parameters are stored struct-of-arrays, parameter index major and model
+// index minor, so every loop over models is unit-stride with one vector lane
+// per model. count is rounded up to NN_BATCH_LANES, the padding models see
+// zero inputs and targets and are never read back. Layers are hard-wired to
+// sigmoid, the per-layer act pointer of nn_t would stop the lanes from
+// vectorizing.
+
+#define NN_BATCH_LANES 16
+
+typedef struct {
+    float* ws; // [prev_width * width][lanes], same order as MAT_AT(ws, k, j)
+    float* bs; // [width][lanes]
+    float* as; // [width][lanes]
+} nn_batch_layer_t;
+
+typedef struct {
+    size_t* arch;
+    size_t arch_count;
+    size_t count;
+    size_t lanes;
+    nn_batch_layer_t* layers;
+} nn_batch_t;
+
+#define NN_BATCH_INPUT(nb) ((nb)->layers[0].as)
+#define NN_BATCH_OUTPUT(nb) ((nb)->layers[(nb)->arch_count-1].as)
+
+// sigmoid over one chunk of lanes, through nn_exp_chunk so it vectorizes
+_Static_assert(NN_BATCH_LANES == NN_EXP_CHUNK, "nn_batch_sigmoid: one lane chunk per nn_exp_chunk");
+
+static inline void nn_batch_sigmoid(float* restrict dst, const float* restrict z)
+{
+    float x[NN_BATCH_LANES], e[NN_BATCH_LANES];
+    for (int m = 0; m < NN_BATCH_LANES; ++m)
+        x[m] = -z[m];
+
+    nn_exp_chunk(e, x);
+
+    for (int m = 0; m < NN_BATCH_LANES; ++m)
+        dst[m] = 1.f / (1.f + e[m]);
+}
+
+void nn_batch_alloc(nn_batch_t* nb, size_t arch[], size_t arch_count, size_t count)
+{
+    NNC_ASSERT(count > 0);
+
+    nb->arch = arch;
+    nb->arch_count = arch_count;
+    nb->count = count;
+    nb->lanes = (count + NN_BATCH_LANES - 1) / NN_BATCH_LANES * NN_BATCH_LANES;
+
+    mem_tag_t owner = memtrack_set_tag(MEM_UNTAGGED);
+    nn_memtag(owner, MEM_UNTAGGED);
+    nb->layers = NNC_MALLOC(sizeof(*nb->layers) * arch_count);
+    nn_memtag(owner, MEM_ACTIVATIONS);
+    nb->layers[0].as = NNC_MALLOC(arch[0] * nb->lanes * sizeof(float));
+    nb->layers[0].ws = NULL;
+    nb->layers[0].bs = NULL;
+    for (size_t i = 1; i < arch_count; ++i) {
+        nn_memtag(owner, MEM_WEIGHTS);
+        nb->layers[i].ws = NNC_MALLOC(arch[i-1] * arch[i] * nb->lanes * sizeof(float));
+        nn_memtag(owner, MEM_BIASES);
+        nb->layers[i].bs = NNC_MALLOC(arch[i] * nb->lanes * sizeof(float));
+        nn_memtag(owner, MEM_ACTIVATIONS);
+        nb->layers[i].as = NNC_MALLOC(arch[i] * nb->lanes * sizeof(float));
+        NNC_ASSERT(nb->layers[i].ws && nb->layers[i].bs && nb->layers[i].as);
+    }
+    memtrack_set_tag(owner);
+    NNC_ASSERT(nb->layers[0].as != NULL);
+}
+
+void nn_batch_free(nn_batch_t* nb)
+{
+    NNC_FREE(nb->layers[0].as);
+    for (size_t i = 1; i < nb->arch_count; ++i) {
+        NNC_FREE(nb->layers[i].ws);
+        NNC_FREE(nb->layers[i].bs);
+        NNC_FREE(nb->layers[i].as);
+    }
+    NNC_FREE(nb->layers);
+}
+
+// flat helpers, n is always a multiple of NN_BATCH_LANES
+static inline void nn_batch_set_all(float* restrict dst, size_t n, float value)
+{
+    for (size_t i = 0; i < n; i += NN_BATCH_LANES)
+        for (int m = 0; m < NN_BATCH_LANES; ++m)
+            dst[i + m] = value;
+}
+
+static inline void nn_batch_scale(float* restrict dst, size_t n, float value)
+{
+    for (size_t i = 0; i < n; i += NN_BATCH_LANES)
+        for (int m = 0; m < NN_BATCH_LANES; ++m)
+            dst[i + m] *= value;
+}
+
+static inline void nn_batch_axpy(float* restrict dst, const float* restrict src, size_t n, float alpha)
+{
+    for (size_t i = 0; i < n; i += NN_BATCH_LANES)
+        for (int m = 0; m < NN_BATCH_LANES; ++m)
+            dst[i + m] += alpha * src[i + m];
+}
+
+void nn_batch_fill(nn_batch_t* nb, float value)
+{
+    for (size_t i = 1; i < nb->arch_count; ++i) {
+        nn_batch_set_all(nb->layers[i].ws, nb->arch[i-1] * nb->arch[i] * nb->lanes, value);
+        nn_batch_set_all(nb->layers[i].bs, nb->arch[i] * nb->lanes, value);
+        nn_batch_set_all(nb->layers[i].as, nb->arch[i] * nb->lanes, value);
+    }
+}
+
+// same stream layout as nn_init: one stream per layer and parameter kind
+void nn_batch_rand(nn_batch_t* nb, float low, float high)
+{
+    rng_t base, layer;
+    rng_seed(&base, rng_next_u64(&tensor_rng), 0);
+
+    for (size_t i = 1; i < nb->arch_count; ++i) {
+        rng_split(&layer, &base, 2 * i);
+        rng_fill_uniform(&layer, nb->layers[i].ws, nb->arch[i-1] * nb->arch[i] * nb->lanes, low, high);
+        rng_split(&layer, &base, 2 * i + 1);
+        rng_fill_uniform(&layer, nb->layers[i].bs, nb->arch[i] * nb->lanes, low, high);
+    }
+}
+
+// nn must have the arch of the batch, layer by layer, and train the way
+// the batch does (sigmoid layers and MSE)
+static void nn_batch_check(const nn_batch_t* nb, size_t m, const nn_t* nn)
+{
+    NNC_ASSERT(m < nb->count && nn->arch_count == nb->arch_count);
+    NNC_ASSERT(nn->loss == NN_LOSS_MSE && "nn_batch: the batch engine is sigmoid/MSE only");
+    NNC_ASSERT(MAT_COLS(&nn->layers[0].as) == nb->arch[0]);
+    for (size_t l = 1; l < nb->arch_count; ++l) {
+        NNC_ASSERT(MAT_ROWS(&nn->layers[l].ws) == nb->arch[l-1]);
+        NNC_ASSERT(MAT_COLS(&nn->layers[l].ws) == nb->arch[l]);
+        NNC_ASSERT(MAT_COLS(&nn->layers[l].bs) == nb->arch[l]);
+    }
+}
+
+// copy model m in or out of the batch, e.g. to checkpoint it on its own
+void nn_batch_get(const nn_batch_t* nb, size_t m, nn_t* nn)
+{
+    nn_batch_check(nb, m, nn);
+
+    const size_t L = nb->lanes;
+    for (size_t l = 1; l < nb->arch_count; ++l) {
+        size_t out = nb->arch[l];
+        for (size_t k = 0; k < nb->arch[l-1]; ++k) {
+            for (size_t j = 0; j < out; ++j) {
+                MAT_AT(&nn->layers[l].ws, k, j) = nb->layers[l].ws[(k * out + j) * L + m];
+            }
+        }
+        for (size_t j = 0; j < out; ++j) {
+            MAT_AT(&nn->layers[l].bs, 0, j) = nb->layers[l].bs[j * L + m];
+        }
+    }
+}
+
+void nn_batch_set(nn_batch_t* nb, size_t m, const nn_t* nn)
+{
+    nn_batch_check(nb, m, nn);
+
+    const size_t L = nb->lanes;
+    for (size_t l = 1; l < nb->arch_count; ++l) {
+        size_t out = nb->arch[l];
+        for (size_t k = 0; k < nb->arch[l-1]; ++k) {
+            for (size_t j = 0; j < out; ++j) {
+                nb->layers[l].ws[(k * out + j) * L + m] = MAT_AT(&nn->layers[l].ws, k, j);
+            }
+        }
+        for (size_t j = 0; j < out; ++j) {
+            nb->layers[l].bs[j * L + m] = MAT_AT(&nn->layers[l].bs, 0, j);
+        }
+    }
+}
+
+// gather sample s of the models in lane chunk c into the input lanes
+static void nn_batch_load_input(nn_batch_t* nb, const tensor_t* targets, size_t s, size_t c)
+{
+    const size_t L = nb->lanes;
+    float* as = NN_BATCH_INPUT(nb) + c;
+    for (size_t i = 0; i < nb->arch[0]; ++i) {
+        for (size_t m = 0; m < NN_BATCH_LANES; ++m) {
+            as[i * L + m] = c + m < nb->count ? MAT_AT(&targets[c + m], s, i) : 0.0f;
+        }
+    }
+}
+
+static inline float nn_batch_target(const nn_batch_t* nb, const tensor_t* targets, size_t s, size_t j, size_t m)
+{
+    return m < nb->count ? MAT_AT(&targets[m], s, nb->arch[0] + j) : 0.0f;
+}
+
+// lanes are independent, so everything runs one chunk of NN_BATCH_LANES
+// models at a time; the inner loops have a constant trip count and the
+// chunk's working set stays in cache across samples
+static void nn_batch_forward_chunk(nn_batch_t* nb, size_t c)
+{
+    const size_t L = nb->lanes;
+    for (size_t l = 1; l < nb->arch_count; ++l) {
+        size_t in = nb->arch[l-1], out = nb->arch[l];
+        const float* restrict a_prev = nb->layers[l-1].as + c;
+        const float* restrict ws = nb->layers[l].ws + c;
+        const float* restrict bs = nb->layers[l].bs + c;
+        float* restrict as = nb->layers[l].as + c;
+
+        for (size_t j = 0; j < out; ++j) {
+            float z[NN_BATCH_LANES];
+            for (int m = 0; m < NN_BATCH_LANES; ++m)
+                z[m] = bs[j * L + m];
+            for (size_t k = 0; k < in; ++k) {
+                const float* restrict a = &a_prev[k * L];
+                const float* restrict w = &ws[(k * out + j) * L];
+                for (int m = 0; m < NN_BATCH_LANES; ++m)
+                    z[m] += a[m] * w[m];
+            }
+            nn_batch_sigmoid(&as[j * L], z);
+        }
+    }
+}
+
+void nn_batch_forward(nn_batch_t* nb)
+{
+    for (size_t c = 0; c < nb->lanes; c += NN_BATCH_LANES)
+        nn_batch_forward_chunk(nb, c);
+}
+
+// targets: one tensor per model, all with the same shape as nn_cost's target
+void nn_batch_cost(nn_batch_t* nb, const tensor_t* targets, float* costs)
+{
+    const size_t L = nb->lanes;
+    size_t samples = MAT_ROWS(&targets[0]);
+    size_t outputs = nb->arch[nb->arch_count - 1];
+    const float* as = NN_BATCH_OUTPUT(nb);
+
+    for (size_t m = 0; m < nb->count; ++m)
+        costs[m] = 0.0f;
+
+    for (size_t c = 0; c < L; c += NN_BATCH_LANES) {
+        size_t end = c + NN_BATCH_LANES < nb->count ? c + NN_BATCH_LANES : nb->count;
+        for (size_t s = 0; s < samples; ++s) {
+            nn_batch_load_input(nb, targets, s, c);
+            nn_batch_forward_chunk(nb, c);
+            for (size_t j = 0; j < outputs; ++j) {
+                for (size_t m = c; m < end; ++m) {
+                    float d = as[j * L + m] - nn_batch_target(nb, targets, s, j, m);
+                    costs[m] += d * d;
+                }
+            }
+        }
+    }
+
+    for (size_t m = 0; m < nb->count; ++m)
+        costs[m] /= samples;
+}
+
+// the lane loops of backprop live in their own functions, the restrict
+// parameters are what lets gcc prove the lanes independent
+
+static inline void nn_batch_mse_grad(float* restrict ga, const float* restrict a, const float* restrict y)
+{
+    for (int m = 0; m < NN_BATCH_LANES; ++m)
+        ga[m] = 2.0f * (a[m] - y[m]);
+}
+
+// delta = dC/da * sigmoid'(a), accumulated into the bias gradient
+static inline void nn_batch_delta(float* restrict delta, float* restrict gb, const float* restrict a, const float* restrict ga)
+{
+    for (int m = 0; m < NN_BATCH_LANES; ++m) {
+        delta[m] = ga[m] * a[m] * (1.0f - a[m]);
+        gb[m] += delta[m];
+    }
+}
+
+// dC/dw_kj += delta_j * a_k and dC/da_k += delta_j * w_kj
+static inline void nn_batch_accumulate(float* restrict gw, float* restrict ga, const float* restrict delta,
+                                       const float* restrict a, const float* restrict w)
+{
+    for (int m = 0; m < NN_BATCH_LANES; ++m) {
+        gw[m] += delta[m] * a[m];
+        ga[m] += delta[m] * w[m];
+    }
+}
+
+void nn_batch_backprop(nn_batch_t* nb, nn_batch_t* grad, const tensor_t* targets)
+{
+    for (size_t m = 0; m < nb->count; ++m) {
+        NNC_ASSERT(MAT_ROWS(&targets[m]) == MAT_ROWS(&targets[0]));
+        NNC_ASSERT(MAT_COLS(&targets[m]) == nb->arch[0] + nb->arch[nb->arch_count - 1]);
+    }
+
+    const size_t L = nb->lanes;
+    size_t samples = MAT_ROWS(&targets[0]);
+    size_t last_layer = nb->arch_count - 1;
+
+    nn_batch_fill(grad, 0.0f);
+
+    for (size_t c = 0; c < L; c += NN_BATCH_LANES) {
+        for (size_t s = 0; s < samples; ++s) {
+            nn_batch_load_input(nb, targets, s, c);
+            nn_batch_forward_chunk(nb, c);
+
+            for (size_t j = 0; j < nb->arch[last_layer]; ++j) {
+                const float* a = NN_BATCH_OUTPUT(nb) + j * L + c;
+                float* ga = NN_BATCH_OUTPUT(grad) + j * L + c;
+                float y[NN_BATCH_LANES];
+                for (size_t m = 0; m < NN_BATCH_LANES; ++m)
+                    y[m] = nn_batch_target(nb, targets, s, j, c + m);
+                nn_batch_mse_grad(ga, a, y);
+            }
+
+            for (size_t l = last_layer; l > 0; --l) {
+                size_t in = nb->arch[l-1], out = nb->arch[l];
+                const float* restrict as = nb->layers[l].as + c;
+                const float* restrict a_prev = nb->layers[l-1].as + c;
+                const float* restrict ws = nb->layers[l].ws + c;
+                float* restrict gws = grad->layers[l].ws + c;
+                float* restrict gbs = grad->layers[l].bs + c;
+                float* restrict gas = grad->layers[l].as + c;
+                float* restrict gas_prev = grad->layers[l-1].as + c;
+
+                for (size_t k = 0; k < in; ++k) {
+                    for (int m = 0; m < NN_BATCH_LANES; ++m)
+                        gas_prev[k * L + m] = 0.0f;
+                }
+
+                for (size_t j = 0; j < out; ++j) {
+                    float delta[NN_BATCH_LANES];
+                    nn_batch_delta(delta, &gbs[j * L], &as[j * L], &gas[j * L]);
+                    for (size_t k = 0; k < in; ++k) {
+                        size_t kj = (k * out + j) * L;
+                        nn_batch_accumulate(&gws[kj], &gas_prev[k * L], delta, &a_prev[k * L], &ws[kj]);
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t l = 1; l < nb->arch_count; ++l) {
+        nn_batch_scale(grad->layers[l].ws, nb->arch[l-1] * nb->arch[l] * L, 1.0f / samples);
+        nn_batch_scale(grad->layers[l].bs, nb->arch[l] * L, 1.0f / samples);
+    }
+}
+
+void nn_batch_learn(nn_batch_t* nb, nn_batch_t* grad, float rate)
+{
+    for (size_t l = 1; l < nb->arch_count; ++l) {
+        nn_batch_axpy(nb->layers[l].ws, grad->layers[l].ws, nb->arch[l-1] * nb->arch[l] * nb->lanes, -rate);
+        nn_batch_axpy(nb->layers[l].bs, grad->layers[l].bs, nb->arch[l] * nb->lanes, -rate);
+    }
+}
+
+void nn_batch_train(nn_batch_t* nb, const tensor_t* targets, size_t epochs, float rate)
+{
+    nn_batch_t grad;
+    mem_tag_t tag = memtrack_set_tag(MEM_GRADIENTS);
+    nn_batch_alloc(&grad, nb->arch, nb->arch_count, nb->count);
+    memtrack_set_tag(tag);
+    u64 allocs = memtrack_alloc_count();
+    for (size_t epoch = 0; epoch < epochs; ++epoch) {
+        nn_batch_backprop(nb, &grad, targets);
+        nn_batch_learn(nb, &grad, rate);
+    }
+    if (memtrack_alloc_count() != allocs)
+        fprintf(stderr, "nn_batch_train: %lu allocations in the training loop\n",
+                memtrack_alloc_count() - allocs);
+    nn_batch_free(&grad);
+}
+
 #define ARRAY_LEN(_arr) sizeof(_arr)/sizeof(_arr[0])
 
+// trains in steps of `step` epochs until every predicted output is within
+// tol of its label, returns the epochs it took or 0 if it never got there
+size_t nn_epochs_to_fit(nn_t* nn, tensor_t* target, size_t max_epochs, size_t step, float rate, float tol)
+{
+    size_t in = MAT_COLS(&NN_INPUT(nn));
+    for (size_t epochs = step; epochs <= max_epochs; epochs += step) {
+        nn_train(nn, target, step, rate, 1);
+
+        bool fit = true;
+        for (size_t i = 0; i < MAT_ROWS(target) && fit; ++i) {
+            for (size_t k = 0; k < in; ++k)
+                MAT_AT(&NN_INPUT(nn), 0, k) = MAT_AT(target, i, k);
+            nn_predict(nn);
+            for (size_t j = 0; j < MAT_COLS(&NN_OUTPUT(nn)); ++j)
+                fit &= fabsf(MAT_AT(&NN_OUTPUT(nn), 0, j) - MAT_AT(target, i, in + j)) < tol;
+        }
+        if (fit)
+            return epochs;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
-    (void)argc;
-    (void)argv;
+    // --autotune[=cache]: pick per-layer kernels for this host
+    const char* tune_cache = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--autotune") == 0)
+            tune_cache = NN_AUTOTUNE_CACHE;
+        else if (strncmp(argv[i], "--autotune=", 11) == 0)
+            tune_cache = &argv[i][11];
+    }
 
     u8 stride = 3;
 
@@ -325,13 +1402,25 @@ int main(int argc, char *argv[])
     tensor_t target;
     MAT_VIEW(&target, train, TRAIN_COUNT, TRAIN_FEATURES + TRAIN_LABEL, stride, 1);
 
-    srand(0);
+    tensor_srand(0);
     nn_t nn;
 
     size_t arch[] = {2, 2, 1};
     nn_alloc(&nn, arch, ARRAY_LEN(arch));
 
     nn_print(&nn);
+    nn_mem_report(&nn, "nn");
+    memtrack_report(stdout);
+
+    stopwatch_t sw;
+    if (tune_cache != NULL) {
+        stopwatch_start(&sw);
+        size_t tuned = nn_autotune(&nn, tune_cache);
+        stopwatch_stop(&sw);
+        printf("autotune: cache(%s), tuned(%ld), time(%f)\n", tune_cache, tuned,
+               stopwatch_get_elapsed_seconds(&sw, get_timer_frequency()));
+        nn_print_kernels(&nn);
+    }
 
     float rate = 1e-1;
     float eps  = 1e-3;
@@ -342,7 +1431,6 @@ int main(int argc, char *argv[])
     size_t finite_epoch = 100 * 1000;
     float finite_time;
 
-    stopwatch_t sw;
     stopwatch_start(&sw);
     nn_train_finite_diff(&nn, &target, finite_epoch, rate, eps, 1);
     stopwatch_stop(&sw);
@@ -375,6 +1463,8 @@ int main(int argc, char *argv[])
     backprop_time = stopwatch_get_elapsed_seconds(&sw, get_timer_frequency());
 
     printf("backprop: cost(%f), epoch(%ld), time(%f)\n", nn_cost(&nn, &target), backprop_epoch, backprop_time);
+    nn_mem_report(&nn, "nn");
+    memtrack_report(stdout);
     printf("-----------------\n");
     for (size_t i = 0; i < 2; ++i) {
         for (size_t j = 0; j < 2; ++j) {
@@ -386,4 +1476,79 @@ int main(int argc, char *argv[])
             printf("%ld %ld = %f\n", i, j, MAT_AT(output, 0, 0));
         }
     }
+
+    // many tiny independent models: one nn_t after another vs a model batch
+    size_t models = 256;
+    size_t models_epoch = 10 * 1000;
+
+    mem_tag_t tag = memtrack_set_tag(MEM_DATASET);
+    tensor_t* targets = NNC_MALLOC(sizeof(*targets) * models);
+    float* costs = NNC_MALLOC(sizeof(*costs) * models);
+    memtrack_set_tag(tag);
+    for (size_t m = 0; m < models; ++m) {
+        targets[m] = target;
+    }
+
+    float cost = 0.0f;
+    stopwatch_start(&sw);
+    for (size_t m = 0; m < models; ++m) {
+        nn_rand(&nn, 0, 1);
+        nn_train(&nn, &target, models_epoch, rate, 1);
+        cost += nn_cost(&nn, &target);
+    }
+    stopwatch_stop(&sw);
+
+    float loop_time = stopwatch_get_elapsed_seconds(&sw, get_timer_frequency());
+    printf("nn loop: models(%ld), mean cost(%f), epoch(%ld), time(%f), models/s(%f)\n",
+           models, cost / models, models_epoch, loop_time, models / loop_time);
+
+    nn_batch_t nb;
+    nn_batch_alloc(&nb, arch, ARRAY_LEN(arch), models);
+    nn_batch_rand(&nb, 0, 1);
+
+    stopwatch_start(&sw);
+    nn_batch_train(&nb, targets, models_epoch, rate);
+    stopwatch_stop(&sw);
+
+    float batch_time = stopwatch_get_elapsed_seconds(&sw, get_timer_frequency());
+    nn_batch_cost(&nb, targets, costs);
+    cost = 0.0f;
+    for (size_t m = 0; m < models; ++m) {
+        cost += costs[m];
+    }
+    printf("nn batch: models(%ld), mean cost(%f), epoch(%ld), time(%f), models/s(%f)\n",
+           models, cost / models, models_epoch, batch_time, models / batch_time);
+
+    // checkpoint a single model back into a nn_t
+    nn_batch_get(&nb, models - 1, &nn);
+    printf("nn batch[%ld]: cost(%f), batch cost(%f)\n", models - 1, nn_cost(&nn, &target), costs[models - 1]);
+    memtrack_report(stdout);
+
+    nn_batch_free(&nb);
+    NNC_FREE(costs);
+    NNC_FREE(targets);
+
+    // classification: same net and init, only the loss differs
+    tensor_t onehot;
+    MAT_VIEW(&onehot, xor_onehot_train, TRAIN_COUNT, TRAIN_FEATURES + 2, TRAIN_FEATURES + 2, 1);
+
+    size_t cls_arch[] = {2, 4, 2};
+    nn_t cls;
+    nn_alloc(&cls, cls_arch, ARRAY_LEN(cls_arch));
+
+    const nn_loss_t losses[] = { NN_LOSS_MSE, NN_LOSS_BCE_LOGITS, NN_LOSS_SOFTMAX_CE };
+    const char* loss_names[] = { "mse", "bce logits", "softmax ce" };
+    for (size_t i = 0; i < ARRAY_LEN(losses); ++i) {
+        tensor_srand(42);
+        nn_set_loss(&cls, losses[i]);
+        nn_rand(&cls, -1, 1);
+
+        stopwatch_start(&sw);
+        size_t epochs = nn_epochs_to_fit(&cls, &onehot, 200 * 1000, 100, rate, 0.1f);
+        stopwatch_stop(&sw);
+
+        printf("%s: epochs to fit(%ld), cost(%f), time(%f)\n", loss_names[i], epochs,
+               nn_cost(&cls, &onehot), stopwatch_get_elapsed_seconds(&sw, get_timer_frequency()));
+    }
+    nn_free(&cls);
 }
@@ -0,0 +1,183 @@
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <stdio.h>
+
+#include "types.h"
+
+// Optional tracking allocator, enabled with -DNNC_MEMTRACK (make MEMTRACK=1).
+//
+// When enabled it is installed behind NNC_MALLOC/NNC_FREE and every block
+// carries a small header with its size and owner tag. Live and peak bytes are
+// kept per tag, plus a power of two size histogram. The allocation counter
+// is also what nn_train uses to catch allocations inside the step loop.
+//
+// When disabled the whole api compiles down to no-ops.
+
+typedef enum {
+    MEM_UNTAGGED,
+    MEM_WEIGHTS,
+    MEM_BIASES,
+    MEM_ACTIVATIONS,
+    MEM_GRADIENTS,
+    MEM_OPTIMIZER,
+    MEM_DATASET,
+    MEM_TAG_COUNT,
+} mem_tag_t;
+
+#define MEMTRACK_HIST_BUCKETS 32
+
+typedef struct {
+    u64 live[MEM_TAG_COUNT];
+    u64 peak[MEM_TAG_COUNT];
+    u64 live_total;
+    u64 peak_total;
+    u64 allocs;
+    u64 frees;
+    u64 hist[MEMTRACK_HIST_BUCKETS]; // hist[i]: sizes in [2^(i-1), 2^i)
+} memtrack_t;
+
+const char* mem_tag_name(mem_tag_t tag);
+
+#ifdef NNC_MEMTRACK
+
+void* memtrack_malloc(size_t size);
+void memtrack_free(void* ptr);
+mem_tag_t memtrack_set_tag(mem_tag_t tag);
+u64 memtrack_alloc_count(void);
+void memtrack_report(FILE* out);
+
+#ifndef NNC_MALLOC
+#define NNC_MALLOC memtrack_malloc
+#endif
+
+#ifndef NNC_FREE
+#define NNC_FREE memtrack_free
+#endif
+
+#else
+
+static inline mem_tag_t memtrack_set_tag(mem_tag_t tag) { (void)tag; return MEM_UNTAGGED; }
+static inline u64 memtrack_alloc_count(void) { return 0; }
+static inline void memtrack_report(FILE* out) { (void)out; }
+
+#endif // NNC_MEMTRACK
+
+#ifdef MEMTRACK_H_IMPLEMENTATION
+
+const char* mem_tag_name(mem_tag_t tag)
+{
+    switch (tag) {
+    case MEM_UNTAGGED:    return "untagged";
+    case MEM_WEIGHTS:     return "weights";
+    case MEM_BIASES:      return "biases";
+    case MEM_ACTIVATIONS: return "activations";
+    case MEM_GRADIENTS:   return "gradients";
+    case MEM_OPTIMIZER:   return "optimizer";
+    case MEM_DATASET:     return "dataset";
+    default:              return "?";
+    }
+}
+
+#ifdef NNC_MEMTRACK
+
+#include <assert.h>
+#include <stdlib.h>
+
+// 16 bytes so the user pointer keeps malloc's alignment
+typedef struct {
+    u64 size;
+    u32 tag;
+    u32 magic;
+} memtrack_hdr_t;
+
+#define MEMTRACK_MAGIC 0x6e6e636dU
+
+memtrack_t memtrack = {0};
+mem_tag_t memtrack_tag = MEM_UNTAGGED;
+
+static void memtrack_account(mem_tag_t tag, u64 size, bool add)
+{
+    if (add) {
+        memtrack.live[tag] += size;
+        memtrack.live_total += size;
+        if (memtrack.live[tag] > memtrack.peak[tag])
+            memtrack.peak[tag] = memtrack.live[tag];
+        if (memtrack.live_total > memtrack.peak_total)
+            memtrack.peak_total = memtrack.live_total;
+    } else {
+        memtrack.live[tag] -= size;
+        memtrack.live_total -= size;
+    }
+}
+
+void* memtrack_malloc(size_t size)
+{
+    memtrack_hdr_t* hdr = malloc(sizeof(*hdr) + size);
+    if (hdr == NULL)
+        return NULL;
+
+    hdr->size = size;
+    hdr->tag = memtrack_tag;
+    hdr->magic = MEMTRACK_MAGIC;
+
+    u32 bucket = 0;
+    while (bucket < MEMTRACK_HIST_BUCKETS - 1 && ((u64)1 << bucket) <= size)
+        bucket++;
+
+    memtrack.allocs++;
+    memtrack.hist[bucket]++;
+    memtrack_account(memtrack_tag, size, true);
+
+    return hdr + 1;
+}
+
+void memtrack_free(void* ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    memtrack_hdr_t* hdr = (memtrack_hdr_t*)ptr - 1;
+    assert(hdr->magic == MEMTRACK_MAGIC && "memtrack_free: not a tracked block");
+
+    memtrack.frees++;
+    memtrack_account(hdr->tag, hdr->size, false);
+    hdr->magic = 0;
+    free(hdr);
+}
+
+mem_tag_t memtrack_set_tag(mem_tag_t tag)
+{
+    mem_tag_t prev = memtrack_tag;
+    memtrack_tag = tag;
+    return prev;
+}
+
+u64 memtrack_alloc_count(void)
+{
+    return memtrack.allocs;
+}
+
+void memtrack_report(FILE* out)
+{
+    fprintf(out, "memtrack: live(%lu) peak(%lu) allocs(%lu) frees(%lu)\n",
+            memtrack.live_total, memtrack.peak_total, memtrack.allocs, memtrack.frees);
+    for (int t = 0; t < MEM_TAG_COUNT; ++t) {
+        if (memtrack.peak[t] == 0)
+            continue;
+        fprintf(out, "  %-12s live(%lu) peak(%lu)\n",
+                mem_tag_name(t), memtrack.live[t], memtrack.peak[t]);
+    }
+    fprintf(out, "  size histogram:\n");
+    for (int b = 0; b < MEMTRACK_HIST_BUCKETS; ++b) {
+        if (memtrack.hist[b] == 0)
+            continue;
+        fprintf(out, "    < %-10lu %lu\n", (u64)1 << b, memtrack.hist[b]);
+    }
+}
+
+#endif // NNC_MEMTRACK
+
+#endif // MEMTRACK_H_IMPLEMENTATION
+
+#endif // MEMTRACK_H
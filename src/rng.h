@@ -0,0 +1,217 @@
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stddef.h>
+
+#include "types.h"
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3").
+//
+// Every value is a pure function of (key, stream, index), there is no hidden
+// state to share between threads. A stream is an independent sequence of
+// 2^64 blocks of 4 u32 each; derive one per layer or per thread with
+// rng_split() and the result does not depend on how the work is scheduled.
+
+#define RNG_PHILOX_M0 0xD2511F53u
+#define RNG_PHILOX_M1 0xCD9E8D57u
+#define RNG_PHILOX_W0 0x9E3779B9u
+#define RNG_PHILOX_W1 0xBB67AE85u
+#define RNG_PHILOX_ROUNDS 10
+
+// The batch fill runs Philox over RNG_BATCH_BLOCKS consecutive blocks at
+// once, one block per vector lane. Its values come in groups of
+// RNG_BATCH_VALUES stored word-major: value j of group g is word
+// j / RNG_BATCH_BLOCKS of block g * RNG_BATCH_BLOCKS + j % RNG_BATCH_BLOCKS,
+// so each lane array is written out as is, with no transpose back into
+// block order. The fill sequence is therefore not the rng_next_u32 sequence.
+#define RNG_BATCH_BLOCKS 16
+#define RNG_BATCH_VALUES (4 * RNG_BATCH_BLOCKS)
+
+typedef struct {
+    u32 key[2];
+    u64 stream;
+    u64 block;  // next block to be generated
+    u32 buf[4]; // leftovers of the last block for the scalar api
+    u8 buf_idx; // 4 when buf is empty
+} rng_t;
+
+static inline void rng_philox(u32 out[4], u64 block, u64 stream, const u32 key[2])
+{
+    u32 c0 = (u32)block, c1 = (u32)(block >> 32);
+    u32 c2 = (u32)stream, c3 = (u32)(stream >> 32);
+    u32 k0 = key[0], k1 = key[1];
+
+    for (int r = 0; r < RNG_PHILOX_ROUNDS; ++r) {
+        u64 p0 = (u64)RNG_PHILOX_M0 * c0;
+        u64 p1 = (u64)RNG_PHILOX_M1 * c2;
+        u32 n0 = (u32)(p1 >> 32) ^ c1 ^ k0;
+        u32 n2 = (u32)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (u32)p1;
+        c3 = (u32)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += RNG_PHILOX_W0;
+        k1 += RNG_PHILOX_W1;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// [0, 1) with the full 24 bits of float mantissa
+static inline float rng_u32_to_unit(u32 x)
+{
+    return (float)(x >> 8) * 0x1p-24f;
+}
+
+static inline void rng_seed(rng_t* rng, u64 seed, u64 stream)
+{
+    rng->key[0] = (u32)seed;
+    rng->key[1] = (u32)(seed >> 32);
+    rng->stream = stream;
+    rng->block = 0;
+    rng->buf_idx = 4;
+}
+
+// child generator with the same key on a stream derived from (parent, id),
+// use it to hand out per-layer or per-thread streams from a single seed
+static inline void rng_split(rng_t* child, const rng_t* parent, u64 id)
+{
+    u32 h[4];
+    rng_philox(h, id, ~parent->stream, parent->key);
+
+    child->key[0] = parent->key[0];
+    child->key[1] = parent->key[1];
+    child->stream = (u64)h[0] | ((u64)h[1] << 32);
+    child->block = 0;
+    child->buf_idx = 4;
+}
+
+static inline u32 rng_next_u32(rng_t* rng)
+{
+    if (rng->buf_idx >= 4) {
+        rng_philox(rng->buf, rng->block++, rng->stream, rng->key);
+        rng->buf_idx = 0;
+    }
+    return rng->buf[rng->buf_idx++];
+}
+
+static inline u64 rng_next_u64(rng_t* rng)
+{
+    u64 lo = rng_next_u32(rng);
+    return lo | ((u64)rng_next_u32(rng) << 32);
+}
+
+static inline float rng_next_f32(rng_t* rng)
+{
+    return rng_u32_to_unit(rng_next_u32(rng));
+}
+
+static inline float rng_uniform(rng_t* rng, float low, float high)
+{
+    return rng_next_f32(rng) * (high - low) + low;
+}
+
+// unbiased integer in [0, n) (Lemire), for shuffles and sampling
+static inline u32 rng_below(rng_t* rng, u32 n)
+{
+    u64 m = (u64)rng_next_u32(rng) * n;
+    u32 l = (u32)m;
+    if (l < n) {
+        u32 t = -n % n;
+        while (l < t) {
+            m = (u64)rng_next_u32(rng) * n;
+            l = (u32)m;
+        }
+    }
+    return (u32)(m >> 32);
+}
+
+// uniform values of fill group `group` into out[RNG_BATCH_VALUES], each loop
+// over l is independent across lanes and vectorizes
+static inline void rng_uniform_group(float* restrict out, u64 group, u64 stream, const u32 key[2], float scale, float low)
+{
+    u32 c0[RNG_BATCH_BLOCKS], c1[RNG_BATCH_BLOCKS];
+    u32 c2[RNG_BATCH_BLOCKS], c3[RNG_BATCH_BLOCKS];
+    u32 k0 = key[0], k1 = key[1];
+
+    for (int l = 0; l < RNG_BATCH_BLOCKS; ++l) {
+        u64 b = group * RNG_BATCH_BLOCKS + l;
+        c0[l] = (u32)b;
+        c1[l] = (u32)(b >> 32);
+        c2[l] = (u32)stream;
+        c3[l] = (u32)(stream >> 32);
+    }
+
+    for (int r = 0; r < RNG_PHILOX_ROUNDS; ++r) {
+        for (int l = 0; l < RNG_BATCH_BLOCKS; ++l) {
+            u64 p0 = (u64)RNG_PHILOX_M0 * c0[l];
+            u64 p1 = (u64)RNG_PHILOX_M1 * c2[l];
+            u32 n0 = (u32)(p1 >> 32) ^ c1[l] ^ k0;
+            u32 n2 = (u32)(p0 >> 32) ^ c3[l] ^ k1;
+            c1[l] = (u32)p1;
+            c3[l] = (u32)p0;
+            c0[l] = n0;
+            c2[l] = n2;
+        }
+        k0 += RNG_PHILOX_W0;
+        k1 += RNG_PHILOX_W1;
+    }
+
+    for (int l = 0; l < RNG_BATCH_BLOCKS; ++l) {
+        out[0 * RNG_BATCH_BLOCKS + l] = (float)(c0[l] >> 8) * scale + low;
+        out[1 * RNG_BATCH_BLOCKS + l] = (float)(c1[l] >> 8) * scale + low;
+        out[2 * RNG_BATCH_BLOCKS + l] = (float)(c2[l] >> 8) * scale + low;
+        out[3 * RNG_BATCH_BLOCKS + l] = (float)(c3[l] >> 8) * scale + low;
+    }
+}
+
+// dst[i] = uniform value number (offset + i) of the fill sequence. Does not
+// touch the rng state, so disjoint [offset, offset + n) ranges can be filled
+// from different threads and give the same bits as a single call.
+static inline void rng_fill_uniform_at(const rng_t* rng, u64 offset, float* dst, size_t n, float low, float high)
+{
+    const float scale = (high - low) * 0x1p-24f;
+    float group[RNG_BATCH_VALUES];
+    size_t i = 0;
+
+    while (i < n) {
+        u64 g = (offset + i) / RNG_BATCH_VALUES;
+        u32 j = (offset + i) % RNG_BATCH_VALUES;
+
+        // whole groups go straight to dst, a partial one at either end of
+        // the range goes through the scratch group
+        bool whole = j == 0 && n - i >= RNG_BATCH_VALUES;
+        rng_uniform_group(whole ? dst + i : group, g, rng->stream, rng->key, scale, low);
+        if (whole) {
+            i += RNG_BATCH_VALUES;
+            continue;
+        }
+        for (; j < RNG_BATCH_VALUES && i < n; ++j, ++i)
+            dst[i] = group[j];
+    }
+}
+
+// claims the next n values of the fill sequence and returns the offset of
+// the first one. Claims start on a group boundary and the rng moves past
+// every block they touch (buffered scalar leftovers are dropped).
+static inline u64 rng_fill_claim(rng_t* rng, size_t n)
+{
+    u64 first = (rng->block + RNG_BATCH_BLOCKS - 1) / RNG_BATCH_BLOCKS;
+    u64 groups = (n + RNG_BATCH_VALUES - 1) / RNG_BATCH_VALUES;
+    rng->block = (first + groups) * RNG_BATCH_BLOCKS;
+    rng->buf_idx = 4;
+    return first * RNG_BATCH_VALUES;
+}
+
+// batch fill from the current position of the rng
+static inline void rng_fill_uniform(rng_t* rng, float* dst, size_t n, float low, float high)
+{
+    u64 offset = rng_fill_claim(rng, n);
+    rng_fill_uniform_at(rng, offset, dst, n, low, high);
+}
+
+#endif // RNG_H_
@@ -2,6 +2,8 @@
 #define TENSOR_H
 
 #include "types.h"
+#include "rng.h"
+#include "memtrack.h"
 
 #ifndef NNC_MALLOC
 #include <stdlib.h>
@@ -20,10 +22,36 @@
 
 #define TENSOR_MAX_DIM 4
 
+// Owned tensors start on a TENSOR_ALIGN boundary and their contiguous
+// dimension is padded to a multiple of TENSOR_PAD floats (one 64 byte
+// vector), so stride[] holds the leading dimension and not the shape. The
+// padding is kept at zero, kernels may run full-width over it without
+// tail handling.
+#define TENSOR_ALIGN 64
+#define TENSOR_PAD (TENSOR_ALIGN / sizeof(float))
+// shortest run worth a padded kernel, below it the padding costs more than
+// the vector loads win
+#define TENSOR_PAD_MIN (TENSOR_PAD / 2)
+
+typedef enum {
+    TENSOR_ROW_MAJOR,
+    TENSOR_COL_MAJOR, // 2d only, MAT_AT(t, i, j) is unit-stride along i
+} tensor_layout_t;
+
+// kernel variants of the ops that have more than one, the autotuner in
+// main.c times them per shape. AUTO decides from the shape alone.
+typedef enum {
+    TENSOR_KERNEL_AUTO,
+    TENSOR_KERNEL_STRIDED,   // plain MAT_AT loops over the logical elements
+    TENSOR_KERNEL_PADDED,    // full-width over the zero padding
+    TENSOR_KERNEL_PADDED_X2, // padded, dot unrolled over two vectors
+    TENSOR_KERNEL_COUNT,
+} tensor_kernel_t;
+
 typedef struct {
     u8 ndim;
     u8 shape[TENSOR_MAX_DIM];
-    u8 stride[TENSOR_MAX_DIM];
+    u32 stride[TENSOR_MAX_DIM];
     u32 size;
     float* data;
     bool view;
@@ -34,8 +62,18 @@ typedef tensor_t mat_t;
 
 void tensor_alloc_view(tensor_t* tensor, u8 ndim, const u8* shape);
 void tensor_alloc(tensor_t* tensor, u8 ndim, const u8* shape);
+void tensor_alloc_layout(tensor_t* tensor, u8 ndim, const u8* shape, tensor_layout_t layout);
+u32 tensor_capacity(const tensor_t* tensor);
+size_t tensor_footprint(const tensor_t* tensor);
+void tensor_axpy(tensor_t* dst, const tensor_t* src, float alpha);
+void tensor_axpy_kernel(tensor_t* dst, const tensor_t* src, float alpha, tensor_kernel_t kernel);
+void tensor_scale(tensor_t* dst, float alpha);
+void tensor_scale_kernel(tensor_t* dst, float alpha, tensor_kernel_t kernel);
+void tensor_2d_dot_product_kernel(tensor_t* dst, const tensor_t* src1, const tensor_t* src2, tensor_kernel_t kernel);
 void tensor_free(tensor_t* tensor);
+void tensor_srand(u64 seed);
 void tensor_rand(tensor_t* tensor, float low, float high);
+void tensor_rand_rng(tensor_t* tensor, rng_t* rng, float low, float high);
 void tensor_fill(tensor_t* tensor, float value);
 void tensor_1d_slice(tensor_t* dst, tensor_t* src, size_t from, size_t to);
 
@@ -43,6 +81,8 @@ void tensor_1d_slice(tensor_t* dst, tensor_t* src, size_t from, size_t to);
 
 #ifdef TENSOR_H_IMPLEMENTATION
 
+#include <string.h>
+
 // MAT utils
 #define MAT_AT(tensor, i, j) \
     ((tensor)->data[(i) * (tensor)->stride[0] + (j) * (tensor)->stride[1]])
@@ -53,6 +93,12 @@ void tensor_1d_slice(tensor_t* dst, tensor_t* src, size_t from, size_t to);
         tensor_alloc(_tensor, 2, _shape);                                      \
     } while (0)
 
+#define MAT_ALLOC_LAYOUT(_tensor, _rows, _cols, _layout)                       \
+    do {                                                                       \
+        u8 _shape[2] = {_rows, _cols};                                         \
+        tensor_alloc_layout(_tensor, 2, _shape, _layout);                      \
+    } while (0)
+
 #define MAT_FREE(_tensor) tensor_free(_tensor)
 
 #define MAT_PRINT(mat) tensor_print(mat, #mat, false)
@@ -82,20 +128,29 @@ void tensor_1d_slice(tensor_t* dst, tensor_t* src, size_t from, size_t to);
 #define ROW_AT(row, j) ((row)->data[(j) * (row)->stride[0]])
 #define ROW_COLS(row) (row)->shape[0]
 
+// default generator behind tensor_rand/randf, not meant to be shared
+// between threads: give each thread its own stream with rng_split()
+rng_t tensor_rng = { .buf_idx = 4 };
+
+void tensor_srand(u64 seed)
+{
+    rng_seed(&tensor_rng, seed, 0);
+}
+
 float randf(void)
 {
-    return (float) rand() / (float) RAND_MAX;
+    return rng_next_f32(&tensor_rng);
 }
 
 float randf_ranged(float low, float high)
 {
-    return randf() * (high - low) + low;
+    return rng_uniform(&tensor_rng, low, high);
 }
 
 void tensor_alloc_view(tensor_t* tensor, u8 ndim, const u8* shape)
 {
     assert(tensor != NULL);
-    assert(ndim != TENSOR_MAX_DIM);
+    assert(ndim > 0 && ndim <= TENSOR_MAX_DIM);
     assert(shape != NULL);
 
     tensor->ndim = ndim;
@@ -117,13 +172,80 @@ void tensor_alloc_view(tensor_t* tensor, u8 ndim, const u8* shape)
     tensor->view = true;
 }
 
-void tensor_alloc(tensor_t* tensor, u8 ndim, const u8* shape)
+static inline u32 tensor_pad(u32 n)
 {
-    tensor_alloc_view(tensor, ndim, shape);
+    return (n + TENSOR_PAD - 1) / TENSOR_PAD * TENSOR_PAD;
+}
+
+// aligned on top of NNC_MALLOC so the allocator hooks still see every
+// block, the pointer returned by NNC_MALLOC is kept right before the data
+static float* tensor_aligned_alloc(size_t bytes)
+{
+    u8* raw = NNC_MALLOC(bytes + TENSOR_ALIGN + sizeof(void*));
+    NNC_ASSERT(raw != NULL);
+
+    uintptr_t addr = (uintptr_t)(raw + sizeof(void*));
+    addr = (addr + TENSOR_ALIGN - 1) & ~(uintptr_t)(TENSOR_ALIGN - 1);
+    ((void**)addr)[-1] = raw;
+    return (float*)addr;
+}
 
-    tensor->data = NNC_MALLOC(tensor->size * sizeof(float));
-    assert(tensor->data != NULL);
+static void tensor_aligned_free(float* data)
+{
+    NNC_FREE(((void**)data)[-1]);
+}
+
+// number of floats spanned by the tensor, padding included. The unit-stride
+// dimension of an owned tensor counts with its padding, so a 1d tensor spans
+// full TENSOR_PAD runs as well.
+u32 tensor_capacity(const tensor_t* tensor)
+{
+    u32 capacity = 0;
+    for (int i = 0; i < tensor->ndim; i++) {
+        u32 extent = tensor->shape[i];
+        if (!tensor->view && tensor->stride[i] == 1)
+            extent = tensor_pad(extent);
+        u32 span = extent * tensor->stride[i];
+        if (span > capacity)
+            capacity = span;
+    }
+    return capacity;
+}
+
+// bytes requested from NNC_MALLOC for an owned tensor: the padded capacity
+// plus the alignment slack and the raw pointer kept before the data
+size_t tensor_footprint(const tensor_t* tensor)
+{
+    if (tensor->view)
+        return 0;
+    return tensor_capacity(tensor) * sizeof(float) + TENSOR_ALIGN + sizeof(void*);
+}
+
+void tensor_alloc_layout(tensor_t* tensor, u8 ndim, const u8* shape, tensor_layout_t layout)
+{
+    tensor_alloc_view(tensor, ndim, shape);
+    NNC_ASSERT(layout == TENSOR_ROW_MAJOR || ndim == 2);
     tensor->view = false;
+
+    if (layout == TENSOR_COL_MAJOR) {
+        tensor->stride[0] = 1;
+        tensor->stride[1] = tensor_pad(shape[0]);
+    } else {
+        u32 stride_val = 1;
+        for (int i = ndim - 1; i >= 0; i--) {
+            tensor->stride[i] = stride_val;
+            stride_val *= i == ndim - 1 ? tensor_pad(shape[i]) : shape[i];
+        }
+    }
+
+    u32 capacity = tensor_capacity(tensor);
+    tensor->data = tensor_aligned_alloc(capacity * sizeof(float));
+    memset(tensor->data, 0, capacity * sizeof(float));
+}
+
+void tensor_alloc(tensor_t* tensor, u8 ndim, const u8* shape)
+{
+    tensor_alloc_layout(tensor, ndim, shape, TENSOR_ROW_MAJOR);
 }
 
 void tensor_free(tensor_t* tensor)
@@ -132,22 +254,104 @@ void tensor_free(tensor_t* tensor)
         return;
 
     if (!tensor->view)
-        NNC_FREE(tensor->data);
+        tensor_aligned_free(tensor->data);
 
     tensor->data = NULL;
 }
 
-void tensor_rand(tensor_t* tensor, float low, float high)
+// calls fn(ptr, len, offset, ctx) for each innermost row of the tensor,
+// offset is the row-major logical index of ptr[0] whatever the storage
+// order. Rows with unit stride come as one run, others element by element.
+// Runs never include padding.
+static void tensor_for_each_run(tensor_t* tensor, void (*fn)(float*, u32, u32, void*), void* ctx)
+{
+    // the row index is unravelled over the outer dimensions
+    int inner = tensor->ndim - 1;
+    u32 len = tensor->shape[inner];
+    u32 rows = len ? tensor->size / len : 0;
+    for (u32 r = 0; r < rows; ++r) {
+        u32 base = 0;
+        u32 rem = r;
+        for (int d = inner - 1; d >= 0; --d) {
+            base += rem % tensor->shape[d] * tensor->stride[d];
+            rem /= tensor->shape[d];
+        }
+
+        if (tensor->stride[inner] == 1) {
+            fn(&tensor->data[base], len, r * len, ctx);
+        } else {
+            for (u32 j = 0; j < len; ++j)
+                fn(&tensor->data[base + j * tensor->stride[inner]], 1, r * len + j, ctx);
+        }
+    }
+}
+
+typedef struct {
+    rng_t* rng;
+    u64 offset;
+    float low;
+    float high;
+} tensor_rand_ctx_t;
+
+static void tensor_rand_run(float* dst, u32 len, u32 offset, void* ctx)
+{
+    tensor_rand_ctx_t* r = ctx;
+    rng_fill_uniform_at(r->rng, r->offset + offset, dst, len, r->low, r->high);
+}
+
+// values are drawn in row-major logical order for every layout, so a seed
+// gives the same tensor whether it is stored row- or column-major
+void tensor_rand_rng(tensor_t* tensor, rng_t* rng, float low, float high)
 {
-    for (size_t i = 0; i < tensor->size; ++i) {
-        tensor->data[i] = randf_ranged(low, high);
+    NNC_ASSERT(tensor != NULL && rng != NULL);
+
+    u64 offset = rng_fill_claim(rng, tensor->size);
+    if (tensor->ndim == 2 && tensor->stride[1] != 1) {
+        // column-major: draw each logical row into a scratch run, scatter it
+        float row[256]; // shapes are u8
+        for (u32 i = 0; i < MAT_ROWS(tensor); ++i) {
+            rng_fill_uniform_at(rng, offset + i * MAT_COLS(tensor), row, MAT_COLS(tensor), low, high);
+            for (u32 j = 0; j < MAT_COLS(tensor); ++j)
+                MAT_AT(tensor, i, j) = row[j];
+        }
+        return;
     }
+
+    tensor_rand_ctx_t ctx = { rng, offset, low, high };
+    tensor_for_each_run(tensor, tensor_rand_run, &ctx);
+}
+
+void tensor_rand(tensor_t* tensor, float low, float high)
+{
+    tensor_rand_rng(tensor, &tensor_rng, low, high);
+}
+
+static void tensor_fill_run(float* dst, u32 len, u32 offset, void* ctx)
+{
+    (void)offset;
+    float value = *(float*)ctx;
+    for (u32 i = 0; i < len; ++i)
+        dst[i] = value;
 }
 
 void tensor_fill(tensor_t* tensor, float value)
 {
-    for (size_t i = 0; i < tensor->size; ++i) {
-        tensor->data[i] = value;
+    if (tensor->ndim == 1) {
+        for (size_t i = 0; i < tensor->size; ++i) {
+            tensor->data[i * tensor->stride[0]] = value;
+        }
+        return;
+    }
+
+    if (tensor->ndim > 2) {
+        tensor_for_each_run(tensor, tensor_fill_run, &value);
+        return;
+    }
+
+    for (size_t i = 0; i < MAT_ROWS(tensor); ++i) {
+        for (size_t j = 0; j < MAT_COLS(tensor); ++j) {
+            MAT_AT(tensor, i, j) = value;
+        }
     }
 }
 
@@ -208,13 +412,152 @@ void tensor_2d_to_1d_row_view(tensor_t* dst, const tensor_t* src, u32 row)
     dst->data = &src->data[row * src->stride[0]];
 }
 
-void tensor_2d_dot_product(tensor_t* dst, const tensor_t* src1, const tensor_t* src2)
+// full-width kernels over padded, aligned runs: n is a multiple of
+// TENSOR_PAD and the padding of the operands is zero
+
+static inline float tensor_dot_padded(const float* restrict a, const float* restrict b, u32 n)
+{
+    float acc[TENSOR_PAD] = {0};
+    for (size_t i = 0; i < n; i += TENSOR_PAD)
+        for (size_t m = 0; m < TENSOR_PAD; ++m)
+            acc[m] += a[i + m] * b[i + m];
+
+    float sum = 0.0f;
+    for (u32 m = 0; m < TENSOR_PAD; ++m)
+        sum += acc[m];
+    return sum;
+}
+
+static inline float tensor_dot_padded_x2(const float* restrict a, const float* restrict b, u32 n)
+{
+    float acc0[TENSOR_PAD] = {0};
+    float acc1[TENSOR_PAD] = {0};
+    size_t i = 0;
+    for (; i + 2 * TENSOR_PAD <= n; i += 2 * TENSOR_PAD) {
+        for (size_t m = 0; m < TENSOR_PAD; ++m) {
+            acc0[m] += a[i + m] * b[i + m];
+            acc1[m] += a[i + TENSOR_PAD + m] * b[i + TENSOR_PAD + m];
+        }
+    }
+    if (i < n) {
+        for (size_t m = 0; m < TENSOR_PAD; ++m)
+            acc0[m] += a[i + m] * b[i + m];
+    }
+
+    float sum = 0.0f;
+    for (u32 m = 0; m < TENSOR_PAD; ++m)
+        sum += acc0[m] + acc1[m];
+    return sum;
+}
+
+static inline void tensor_axpy_padded(float* restrict dst, const float* restrict src, float alpha, u32 n)
+{
+    for (size_t i = 0; i < n; i += TENSOR_PAD)
+        for (size_t m = 0; m < TENSOR_PAD; ++m)
+            dst[i + m] += alpha * src[i + m];
+}
+
+static inline void tensor_scale_padded(float* restrict dst, float alpha, u32 n)
+{
+    for (size_t i = 0; i < n; i += TENSOR_PAD)
+        for (size_t m = 0; m < TENSOR_PAD; ++m)
+            dst[i + m] *= alpha;
+}
+
+// padded kernels for elementwise ops go flat over the allocation, AUTO
+// takes them unless the padding would more than double the work
+static inline bool tensor_elementwise_padded(const tensor_t* dst, tensor_kernel_t kernel)
+{
+    if (kernel == TENSOR_KERNEL_AUTO)
+        return tensor_capacity(dst) <= 2 * dst->size;
+    return kernel != TENSOR_KERNEL_STRIDED;
+}
+
+// dst += alpha * src, both owned 2d with the same layout
+void tensor_axpy_kernel(tensor_t* dst, const tensor_t* src, float alpha, tensor_kernel_t kernel)
+{
+    NNC_ASSERT(!dst->view && !src->view);
+    NNC_ASSERT(dst->ndim == 2 && src->ndim == 2);
+    NNC_ASSERT(MAT_ROWS(dst) == MAT_ROWS(src) && MAT_COLS(dst) == MAT_COLS(src));
+    NNC_ASSERT(dst->stride[0] == src->stride[0] && dst->stride[1] == src->stride[1]);
+
+    if (tensor_elementwise_padded(dst, kernel)) {
+        tensor_axpy_padded(dst->data, src->data, alpha, tensor_capacity(dst));
+        return;
+    }
+
+    for (size_t i = 0; i < MAT_ROWS(dst); ++i) {
+        for (size_t j = 0; j < MAT_COLS(dst); ++j) {
+            MAT_AT(dst, i, j) += alpha * MAT_AT(src, i, j);
+        }
+    }
+}
+
+void tensor_axpy(tensor_t* dst, const tensor_t* src, float alpha)
+{
+    tensor_axpy_kernel(dst, src, alpha, TENSOR_KERNEL_AUTO);
+}
+
+void tensor_scale_kernel(tensor_t* dst, float alpha, tensor_kernel_t kernel)
+{
+    NNC_ASSERT(!dst->view && dst->ndim == 2);
+
+    if (tensor_elementwise_padded(dst, kernel)) {
+        tensor_scale_padded(dst->data, alpha, tensor_capacity(dst));
+        return;
+    }
+
+    for (size_t i = 0; i < MAT_ROWS(dst); ++i) {
+        for (size_t j = 0; j < MAT_COLS(dst); ++j) {
+            MAT_AT(dst, i, j) *= alpha;
+        }
+    }
+}
+
+void tensor_scale(tensor_t* dst, float alpha)
+{
+    tensor_scale_kernel(dst, alpha, TENSOR_KERNEL_AUTO);
+}
+
+void tensor_2d_dot_product_kernel(tensor_t* dst, const tensor_t* src1, const tensor_t* src2, tensor_kernel_t kernel)
 {
     NNC_ASSERT(dst != NULL && src1 != NULL && src2 != NULL);
     NNC_ASSERT(MAT_COLS(src1) == MAT_ROWS(src2));
     NNC_ASSERT(MAT_ROWS(dst) == MAT_ROWS(src1));
     NNC_ASSERT(MAT_COLS(dst) == MAT_COLS(src2));
-    
+
+    // row vector times an owned matrix, the shape of every layer in nn_forward.
+    // src1 and dst are accessed as single unit-stride padded rows.
+    bool padded = !dst->view && !src1->view && !src2->view && MAT_ROWS(src1) == 1
+        && src1->stride[1] == 1 && dst->stride[1] == 1;
+    bool col_major = src2->stride[0] == 1;
+
+    if (kernel == TENSOR_KERNEL_AUTO) {
+        u32 run = col_major ? MAT_ROWS(src2) : MAT_COLS(src2);
+        kernel = run >= TENSOR_PAD_MIN ? TENSOR_KERNEL_PADDED : TENSOR_KERNEL_STRIDED;
+    }
+
+    if (padded && col_major && kernel != TENSOR_KERNEL_STRIDED) {
+        // column-major: each output is a dot of two unit-stride runs
+        for (u32 j = 0; j < MAT_COLS(src2); ++j) {
+            const float* col = &MAT_AT(src2, 0, j);
+            MAT_AT(dst, 0, j) = kernel == TENSOR_KERNEL_PADDED_X2
+                ? tensor_dot_padded_x2(src1->data, col, src2->stride[1])
+                : tensor_dot_padded(src1->data, col, src2->stride[1]);
+        }
+        return;
+    }
+
+    if (padded && src2->stride[1] == 1 && kernel != TENSOR_KERNEL_STRIDED) {
+        // row-major: accumulate whole rows of src2 into dst
+        u32 n = tensor_pad(MAT_COLS(dst));
+        memset(dst->data, 0, n * sizeof(float));
+        for (u32 k = 0; k < MAT_COLS(src1); ++k) {
+            tensor_axpy_padded(dst->data, &MAT_AT(src2, k, 0), MAT_AT(src1, 0, k), n);
+        }
+        return;
+    }
+
     for (u32 i = 0; i < MAT_ROWS(src1); ++i) {
         for (u32 j = 0; j < MAT_COLS(src2); ++j) {
             float sum = 0.0f;
@@ -226,6 +569,11 @@ void tensor_2d_dot_product(tensor_t* dst, const tensor_t* src1, const tensor_t*
     }
 }
 
+void tensor_2d_dot_product(tensor_t* dst, const tensor_t* src1, const tensor_t* src2)
+{
+    tensor_2d_dot_product_kernel(dst, src1, src2, TENSOR_KERNEL_AUTO);
+}
+
 void tensor_2d_sum(tensor_t* dst, tensor_t* a)
 {
     NNC_ASSERT(dst->shape[0] == a->shape[0]);